@@ -73,6 +73,27 @@ namespace sp {
         return timestamp;
     }
 
+    // RFC 7231 IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT", as used by Last-Modified
+    static std::string HTTPDateString(time_t timestamp = time(NULL)) {
+        char buffer[32];
+
+        struct tm timeInfo;
+        gmtime_r(&timestamp, &timeInfo);
+        strftime(buffer, 32, "%a, %d %b %Y %H:%M:%S GMT", &timeInfo);
+
+        return std::string(buffer);
+    }
+
+    static time_t HTTPDateToTimestamp(const char* httpDateString) {
+        struct tm timeInfo = {};
+
+        if (strptime(httpDateString, "%a, %d %b %Y %H:%M:%S GMT", &timeInfo) == NULL) {
+            return -1;
+        }
+
+        return timegm(&timeInfo);
+    }
+
     static time_t __LAST_TIMESTAMP = 0;
 
     static double timelap() {
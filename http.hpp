@@ -2,10 +2,14 @@
 #include "server.hpp"
 #include "threadpool.hpp"
 #include "dsalgo.hpp"
+#include "simd.hpp"
 #include <cstdio>
 #include <iterator>
 #include <utility>
 #include <regex>
+#include <atomic>
+#include <string_view>
+#include <memory>
 
 #ifndef HTTP_MAX_HEADER_SIZE
 #define HTTP_MAX_HEADER_SIZE 16 * 1024        // 16KB
@@ -13,9 +17,33 @@
 #ifndef HTTP_RESPONSE_BUFFER_SIZE
 #define HTTP_RESPONSE_BUFFER_SIZE 1024 * 1024 // 1MB
 #endif
+#ifndef HTTP_RESPONSE_HEAD_SIZE
+#define HTTP_RESPONSE_HEAD_SIZE 8 * 1024      // stack space for a response's status line and headers
+#endif
+#ifndef HTTP_STREAM_CHUNK_SIZE
+#define HTTP_STREAM_CHUNK_SIZE 64 * 1024      // streamed writes are coalesced into chunks this large
+#endif
 #ifndef HTTP_QUERY_BUFFER_SIZE
 #define HTTP_QUERY_BUFFER_SIZE 512 
 #endif
+#ifndef HTTP_MAX_REQUEST_SIZE
+#define HTTP_MAX_REQUEST_SIZE 8 * 1024 * 1024 // 8MB, largest request a reactor will buffer
+#endif
+#ifndef HTTP_REACTOR_MAX_EVENTS
+#define HTTP_REACTOR_MAX_EVENTS 256
+#endif
+#ifndef HTTP_MAX_HEADERS
+#define HTTP_MAX_HEADERS 64
+#endif
+#ifndef HTTP_MAX_ROUTE_PARAMS
+#define HTTP_MAX_ROUTE_PARAMS 8
+#endif
+#ifndef HTTP_KEEP_ALIVE_TIMEOUT
+#define HTTP_KEEP_ALIVE_TIMEOUT 5             // seconds an idle persistent connection is kept
+#endif
+#ifndef HTTP_KEEP_ALIVE_MAX_REQUESTS
+#define HTTP_KEEP_ALIVE_MAX_REQUESTS 1000
+#endif
 
 #define HTTP_HEADER_SEPARATOR "\r\n"
 #define HTTP_SEPARATOR "\r\n\r\n"
@@ -31,8 +59,12 @@ namespace sp
     constexpr const uint32_t HTTP_METHOD_OPTIONS = 5;
     constexpr const uint32_t HTTP_METHOD_TRACE = 6;
     constexpr const uint32_t HTTP_METHOD_CONNECT = 7;
+    constexpr const uint32_t HTTP_METHOD_COUNT = 8;
     constexpr const uint32_t HTTP_INVALID = -1;
 
+    constexpr const uint32_t HTTP_SERVER_BLOCKING = 0; // one blocking accept loop, workers read the socket
+    constexpr const uint32_t HTTP_SERVER_REACTOR = 1;  // edge-triggered epoll reactors, workers get complete requests
+
     static uint32_t HTTPgetMethod(const char *method)
     {
         if (strcmp(method, "GET") == 0)
@@ -54,77 +86,520 @@ namespace sp
         return HTTP_INVALID;
     }
 
-    struct HTTPHeaders
+    static uint32_t HTTPgetMethod(std::string_view method)
+    {
+        switch (method.size())
+        {
+        case 3:
+            if (method == "GET")
+                return HTTP_METHOD_GET;
+            if (method == "PUT")
+                return HTTP_METHOD_PUT;
+            break;
+        case 4:
+            if (method == "POST")
+                return HTTP_METHOD_POST;
+            if (method == "HEAD")
+                return HTTP_METHOD_HEAD;
+            break;
+        case 5:
+            if (method == "TRACE")
+                return HTTP_METHOD_TRACE;
+            break;
+        case 6:
+            if (method == "DELETE")
+                return HTTP_METHOD_DELETE;
+            break;
+        case 7:
+            if (method == "OPTIONS")
+                return HTTP_METHOD_OPTIONS;
+            if (method == "CONNECT")
+                return HTTP_METHOD_CONNECT;
+            break;
+        }
+        return HTTP_INVALID;
+    }
+
+    constexpr const int32_t HTTP_PARSE_INCOMPLETE = 0;
+    constexpr const int32_t HTTP_PARSE_DONE = 1;
+    constexpr const int32_t HTTP_PARSE_ERROR = -1;
+
+    constexpr const int64_t HTTP_REQUEST_MALFORMED = -1;
+    constexpr const int64_t HTTP_REQUEST_TOO_LARGE = -2;
+
+    // resumable request-head parser. It walks each byte exactly once, remembering where it
+    // stopped so the next call after a partial read continues from there. Runs of path,
+    // header name and header value bytes are skipped with the SIMD scanner from simd.hpp. Positions are kept
+    // as offsets so the receive buffer may be reallocated between calls; views are handed
+    // out once the head is complete
+    struct HTTPParser
     {
-        char *_content;
-        uint64_t _size;
-        std::vector<char *> _headerPtrs;
+        enum State : uint8_t
+        {
+            METHOD,
+            PATH,
+            VERSION,
+            REQUEST_LINE_LF,
+            HEADER_START,
+            HEADER_NAME,
+            HEADER_VALUE_START,
+            HEADER_VALUE,
+            HEADER_LF,
+            HEADERS_END_LF,
+            DONE,
+            ERROR
+        };
 
-        uint64_t create(char *content)
+        // left uninitialised on purpose, ranges are only read back once the parse is DONE
+        struct Range
         {
-            _content = content;
-            char *contentEnd = strstr(content, HTTP_SEPARATOR);
-            strcpy(contentEnd, "\0");
-            _size = sizeof(content);
-            if (_size == 0)
-                return 0;
-            char *line = content;
+            uint32_t start;
+            uint32_t end;
+        };
 
-            while (line)
+        struct Header
+        {
+            Range name;
+            Range value;
+        };
+
+        State _state = METHOD;
+        uint32_t _offset = 0;
+        uint32_t _tokenStart = 0;
+        Range _method;
+        Range _path;
+        Range _version;
+        Header _headers[HTTP_MAX_HEADERS];
+        uint32_t _headerCount = 0;
+        uint32_t _headerLength = 0;
+        uint64_t _contentLength = 0;
+
+        void reset()
+        {
+            _state = METHOD;
+            _offset = 0;
+            _tokenStart = 0;
+            _headerCount = 0;
+            _headerLength = 0;
+            _contentLength = 0;
+        }
+
+        // feeds buffer[0, size); bytes before the previous stopping point are not looked at again
+        int32_t parse(const char *buffer, uint32_t size)
+        {
+            uint32_t i = _offset;
+            for (; i < size && _state < DONE; ++i)
             {
-                char *lineend = strstr(line, HTTP_HEADER_SEPARATOR);
-                if (lineend == nullptr)
+                uint8_t c = (uint8_t)buffer[i];
+                switch (_state)
+                {
+                case METHOD:
+                    if (c == ' ' && i > _tokenStart)
+                    {
+                        _method = {_tokenStart, i};
+                        _tokenStart = i + 1;
+                        _state = PATH;
+                    }
+                    else if (c < 'A' || c > 'Z')
+                        _state = ERROR;
+                    break;
+                case PATH:
+                {
+                    i = findAny(buffer + i, buffer + size, ' ', '\r', '\n', '\t') - buffer;
+                    if (i == size)
+                    {
+                        i = size - 1;
+                        break;
+                    }
+                    if (buffer[i] == ' ' && i > _tokenStart)
+                    {
+                        _path = {_tokenStart, i};
+                        _tokenStart = i + 1;
+                        _state = VERSION;
+                    }
+                    else
+                        _state = ERROR;
+                    break;
+                }
+                case VERSION:
+                    if (c == '\r' || c == '\n')
+                    {
+                        _version = {_tokenStart, i};
+                        _state = c == '\r' ? REQUEST_LINE_LF : HEADER_START;
+                        if (i - _tokenStart != 8 || memcmp(buffer + _tokenStart, "HTTP/1.", 7) != 0)
+                            _state = ERROR;
+                    }
+                    break;
+                case REQUEST_LINE_LF:
+                    _state = c == '\n' ? HEADER_START : ERROR;
+                    break;
+                case HEADER_START:
+                    if (c == '\r')
+                        _state = HEADERS_END_LF;
+                    else if (c == '\n')
+                        __finish(i);
+                    else if (c <= ' ' || c == ':' || _headerCount == HTTP_MAX_HEADERS)
+                        _state = ERROR;
+                    else
+                    {
+                        _tokenStart = i;
+                        _state = HEADER_NAME;
+                    }
                     break;
-                char *key = strtok(line, ":");
-                char *value = strtok(nullptr, HTTP_HEADER_SEPARATOR);
-                _headerPtrs.push_back(key);
-                _headerPtrs.push_back((char *)ltrim(value));
-                line = lineend + 2;
+                case HEADER_NAME:
+                {
+                    i = findAny(buffer + i, buffer + size, ':', '\r', '\n', ' ') - buffer;
+                    if (i == size)
+                    {
+                        i = size - 1;
+                        break;
+                    }
+                    if (buffer[i] == ':')
+                    {
+                        _headers[_headerCount].name = {_tokenStart, i};
+                        _state = HEADER_VALUE_START;
+                    }
+                    else
+                        _state = ERROR;
+                    break;
+                }
+                case HEADER_VALUE_START:
+                    if (c == ' ' || c == '\t')
+                        break;
+                    _tokenStart = i;
+                    _state = HEADER_VALUE;
+                    // fall through
+                case HEADER_VALUE:
+                {
+                    i = findAny(buffer + i, buffer + size, '\r', '\n', '\r', '\n') - buffer;
+                    if (i == size)
+                    {
+                        i = size - 1;
+                        break;
+                    }
+                    __commitHeader(buffer, i);
+                    _state = buffer[i] == '\r' ? HEADER_LF : HEADER_START;
+                    break;
+                }
+                case HEADER_LF:
+                    _state = c == '\n' ? HEADER_START : ERROR;
+                    break;
+                case HEADERS_END_LF:
+                    if (c == '\n')
+                        __finish(i);
+                    else
+                        _state = ERROR;
+                    break;
+                default:
+                    break;
+                }
             }
-            return _size;
+            _offset = i;
+            if (_state == DONE)
+                return HTTP_PARSE_DONE;
+            return _state == ERROR ? HTTP_PARSE_ERROR : HTTP_PARSE_INCOMPLETE;
         }
-        char *get(const std::string &key)
+
+        std::string_view view(const char *buffer, const Range &range) const
         {
-            for (uint32_t i = 0; i < _headerPtrs.size(); i += 2)
-            {
-                if (strcmp(_headerPtrs[i], key.c_str()) == 0)
-                    return _headerPtrs[i + 1];
-            }
-            return nullptr;
+            return std::string_view(buffer + range.start, range.end - range.start);
         }
 
-        void set(char *key, char *&value)
+        void __commitHeader(const char *buffer, uint32_t valueEnd)
         {
-            for (uint32_t i = 0; i < _headerPtrs.size(); i += 2)
+            // trailing whitespace is not part of the value
+            while (valueEnd > _tokenStart && (buffer[valueEnd - 1] == ' ' || buffer[valueEnd - 1] == '\t'))
+                valueEnd--;
+            Header &header = _headers[_headerCount++];
+            header.value = {_tokenStart, valueEnd};
+            if (header.name.end - header.name.start == 14 && strncasecmp(buffer + header.name.start, "Content-Length", 14) == 0)
             {
-                if (strcmp(_headerPtrs[i], key) == 0)
+                _contentLength = 0;
+                for (uint32_t j = header.value.start; j < header.value.end; ++j)
                 {
-                    _headerPtrs[i + 1] = value;
-                    return;
+                    uint32_t digit = (uint8_t)buffer[j] - '0';
+                    if (digit > 9)
+                    {
+                        _state = ERROR;
+                        return;
+                    }
+                    _contentLength = _contentLength * 10 + digit;
                 }
             }
+        }
 
-            _headerPtrs.push_back((char *)key);
-            _headerPtrs.push_back((char *)value);
+        void __finish(uint32_t i)
+        {
+            _headerLength = i + 1;
+            _state = DONE;
         }
+    };
 
-        uint32_t print(char *buffer, uint32_t size)
+    // appends into a fixed caller-owned buffer (normally on the stack); once something does
+    // not fit the builder stops writing and reports overflow instead of truncating silently
+    struct HTTPHeaderBuilder
+    {
+        char *_data = nullptr;
+        uint32_t _size = 0;
+        uint32_t _capacity = 0;
+        bool _overflow = false;
+
+        HTTPHeaderBuilder(char *data, uint32_t capacity) : _data(data), _capacity(capacity) {}
+
+        void append(const char *text, uint32_t length)
         {
-            uint32_t offset = 0;
-            for (uint32_t i = 0; i < _headerPtrs.size(); i += 2)
+            if (_overflow || _size + length > _capacity)
             {
-                offset += sprintf(buffer + offset, "%s: %s\r\n", _headerPtrs[i], _headerPtrs[i + 1]);
-                if (offset >= size - 2)
-                    break;
+                _overflow = true;
+                return;
+            }
+            memcpy(_data + _size, text, length);
+            _size += length;
+        }
+
+        void append(std::string_view text)
+        {
+            append(text.data(), text.size());
+        }
+
+        void appendNumber(uint64_t value)
+        {
+            char digits[20];
+            uint32_t count = 0;
+            do
+            {
+                digits[19 - count++] = '0' + value % 10;
+                value /= 10;
+            } while (value);
+            append(digits + 20 - count, count);
+        }
+
+        void appendHeader(std::string_view key, std::string_view value)
+        {
+            append(key);
+            append(": ", 2);
+            append(value);
+            append("\r\n", 2);
+        }
+    };
+
+    // well-known headers get a fixed id so hot lookups skip hashing and probing entirely
+    constexpr const uint32_t HTTP_HEADER_CONTENT_LENGTH = 0;
+    constexpr const uint32_t HTTP_HEADER_CONTENT_TYPE = 1;
+    constexpr const uint32_t HTTP_HEADER_USER_AGENT = 2;
+    constexpr const uint32_t HTTP_HEADER_CONNECTION = 3;
+    constexpr const uint32_t HTTP_HEADER_HOST = 4;
+    constexpr const uint32_t HTTP_HEADER_ACCEPT = 5;
+    constexpr const uint32_t HTTP_HEADER_ACCEPT_ENCODING = 6;
+    constexpr const uint32_t HTTP_HEADER_TRANSFER_ENCODING = 7;
+    constexpr const uint32_t HTTP_HEADER_CONTENT_ENCODING = 8;
+    constexpr const uint32_t HTTP_HEADER_COOKIE = 9;
+    constexpr const uint32_t HTTP_HEADER_AUTHORIZATION = 10;
+    constexpr const uint32_t HTTP_HEADER_EXPECT = 11;
+    constexpr const uint32_t HTTP_HEADER_IF_NONE_MATCH = 12;
+    constexpr const uint32_t HTTP_HEADER_IF_MODIFIED_SINCE = 13;
+    constexpr const uint32_t HTTP_HEADER_RANGE = 14;
+    constexpr const uint32_t HTTP_HEADER_CACHE_CONTROL = 15;
+    constexpr const uint32_t HTTP_HEADER_KNOWN_COUNT = 16;
+    constexpr const uint32_t HTTP_HEADER_UNKNOWN = -1;
+
+    static const std::string_view HTTP_KNOWN_HEADERS[HTTP_HEADER_KNOWN_COUNT] = {
+        "Content-Length", "Content-Type", "User-Agent", "Connection",
+        "Host", "Accept", "Accept-Encoding", "Transfer-Encoding",
+        "Content-Encoding", "Cookie", "Authorization", "Expect",
+        "If-None-Match", "If-Modified-Since", "Range", "Cache-Control"};
+
+    // FNV-1a over the name with ASCII letters folded to lower case
+    constexpr uint32_t HTTPheaderHash(std::string_view name)
+    {
+        uint32_t hash = 2166136261u;
+        for (char c : name)
+            hash = (hash ^ (uint8_t)(c >= 'A' && c <= 'Z' ? c | 0x20 : c)) * 16777619u;
+        return hash;
+    }
+
+    static uint32_t HTTPheaderId(std::string_view name, uint32_t hash)
+    {
+        uint32_t id = HTTP_HEADER_UNKNOWN;
+        switch (hash)
+        {
+        case HTTPheaderHash("content-length"): id = HTTP_HEADER_CONTENT_LENGTH; break;
+        case HTTPheaderHash("content-type"): id = HTTP_HEADER_CONTENT_TYPE; break;
+        case HTTPheaderHash("user-agent"): id = HTTP_HEADER_USER_AGENT; break;
+        case HTTPheaderHash("connection"): id = HTTP_HEADER_CONNECTION; break;
+        case HTTPheaderHash("host"): id = HTTP_HEADER_HOST; break;
+        case HTTPheaderHash("accept"): id = HTTP_HEADER_ACCEPT; break;
+        case HTTPheaderHash("accept-encoding"): id = HTTP_HEADER_ACCEPT_ENCODING; break;
+        case HTTPheaderHash("transfer-encoding"): id = HTTP_HEADER_TRANSFER_ENCODING; break;
+        case HTTPheaderHash("content-encoding"): id = HTTP_HEADER_CONTENT_ENCODING; break;
+        case HTTPheaderHash("cookie"): id = HTTP_HEADER_COOKIE; break;
+        case HTTPheaderHash("authorization"): id = HTTP_HEADER_AUTHORIZATION; break;
+        case HTTPheaderHash("expect"): id = HTTP_HEADER_EXPECT; break;
+        case HTTPheaderHash("if-none-match"): id = HTTP_HEADER_IF_NONE_MATCH; break;
+        case HTTPheaderHash("if-modified-since"): id = HTTP_HEADER_IF_MODIFIED_SINCE; break;
+        case HTTPheaderHash("range"): id = HTTP_HEADER_RANGE; break;
+        case HTTPheaderHash("cache-control"): id = HTTP_HEADER_CACHE_CONTROL; break;
+        default: return HTTP_HEADER_UNKNOWN;
+        }
+        const std::string_view &known = HTTP_KNOWN_HEADERS[id];
+        if (known.size() != name.size() || strncasecmp(known.data(), name.data(), name.size()) != 0)
+            return HTTP_HEADER_UNKNOWN;
+        return id;
+    }
+
+    // header names and values are pointers into the request (or caller) memory. Names are
+    // matched case-insensitively through a small open-addressing table keyed by
+    // HTTPheaderHash; repeated names are chained so every value is kept, in arrival order
+    struct HTTPHeaders
+    {
+        static constexpr uint32_t TABLE_SIZE = 2 * HTTP_MAX_HEADERS; // power of two, at most half full
+
+        struct Entry
+        {
+            char *key;
+            char *value;
+            uint32_t hash;
+            uint16_t keyLength;
+            int8_t next; // next entry with the same name, -1 at the end
+        };
+
+        Entry _entries[HTTP_MAX_HEADERS];
+        uint32_t _count = 0;
+        int8_t _slots[TABLE_SIZE];
+        int8_t _known[HTTP_HEADER_KNOWN_COUNT];
+
+        HTTPHeaders()
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            _count = 0;
+            memset(_slots, -1, sizeof(_slots));
+            memset(_known, -1, sizeof(_known));
+        }
+
+        // appends a value; a name seen before becomes a multi-value header
+        bool add(char *key, uint32_t keyLength, char *value)
+        {
+            if (_count == HTTP_MAX_HEADERS)
+                return false;
+            uint32_t hash = HTTPheaderHash(std::string_view(key, keyLength));
+            int8_t index = (int8_t)_count++;
+            _entries[index] = {key, value, hash, (uint16_t)keyLength, -1};
+
+            uint32_t slot = __find(key, keyLength, hash);
+            if (_slots[slot] < 0)
+            {
+                _slots[slot] = index;
+                uint32_t id = HTTPheaderId(std::string_view(key, keyLength), hash);
+                if (id != HTTP_HEADER_UNKNOWN)
+                    _known[id] = index;
+                return true;
+            }
+            int8_t last = _slots[slot];
+            while (_entries[last].next >= 0)
+                last = _entries[last].next;
+            _entries[last].next = index;
+            return true;
+        }
+
+        bool add(char *key, char *value)
+        {
+            return add(key, strlen(key), value);
+        }
+
+        char *get(std::string_view key) const
+        {
+            int8_t index = _slots[__find(key.data(), key.size(), HTTPheaderHash(key))];
+            return index < 0 ? nullptr : _entries[index].value;
+        }
+
+        char *get(const char *key) const
+        {
+            return get(std::string_view(key));
+        }
+
+        char *get(const std::string &key) const
+        {
+            return get(std::string_view(key));
+        }
+
+        // O(1) access for the HTTP_HEADER_* ids
+        char *get(uint32_t id) const
+        {
+            int8_t index = id < HTTP_HEADER_KNOWN_COUNT ? _known[id] : -1;
+            return index < 0 ? nullptr : _entries[index].value;
+        }
+
+        // every value sent under key, returns how many there are (may exceed maxValues)
+        uint32_t getAll(std::string_view key, char **values, uint32_t maxValues) const
+        {
+            uint32_t found = 0;
+            for (int8_t index = _slots[__find(key.data(), key.size(), HTTPheaderHash(key))]; index >= 0; index = _entries[index].next)
+            {
+                if (found < maxValues)
+                    values[found] = _entries[index].value;
+                found++;
+            }
+            return found;
+        }
+
+        // replaces every value of key with a single one
+        void set(char *key, char *&value)
+        {
+            uint32_t keyLength = strlen(key);
+            int8_t index = _slots[__find(key, keyLength, HTTPheaderHash(std::string_view(key, keyLength)))];
+            if (index < 0)
+            {
+                add(key, keyLength, value);
+                return;
             }
-            offset += sprintf(buffer + offset, "\r\n");
-            return offset;
+            _entries[index].value = value;
+            for (int8_t next = _entries[index].next; next >= 0; next = _entries[next].next)
+                _entries[next].value = nullptr;
+            _entries[index].next = -1;
+        }
+
+        void write(HTTPHeaderBuilder &builder) const
+        {
+            for (uint32_t i = 0; i < _count; ++i)
+            {
+                if (_entries[i].value != nullptr)
+                    builder.appendHeader(std::string_view(_entries[i].key, _entries[i].keyLength), _entries[i].value);
+            }
+        }
+
+        uint32_t print(char *buffer, uint32_t size)
+        {
+            HTTPHeaderBuilder builder(buffer, size);
+            write(builder);
+            builder.append("\r\n", 2);
+            return builder._overflow ? 0 : builder._size;
         }
 
         int32_t count() const
         {
-            return _headerPtrs.size() / 2;
+            int32_t count = 0;
+            for (uint32_t i = 0; i < _count; ++i)
+                count += _entries[i].value != nullptr;
+            return count;
         };
+
+        // slot holding key, or the empty slot where it would go
+        uint32_t __find(const char *key, uint32_t keyLength, uint32_t hash) const
+        {
+            uint32_t slot = hash & (TABLE_SIZE - 1);
+            while (_slots[slot] >= 0)
+            {
+                const Entry &entry = _entries[_slots[slot]];
+                if (entry.hash == hash && entry.keyLength == keyLength && strncasecmp(entry.key, key, keyLength) == 0)
+                    return slot;
+                slot = (slot + 1) & (TABLE_SIZE - 1);
+            }
+            return slot;
+        }
     };
 
     struct HTTPRequest
@@ -135,14 +610,23 @@ namespace sp
         char *_contentType = nullptr;
         char *_path = nullptr;
         char *_userAgent = nullptr;
+        std::string_view _methodView;
+        std::string_view _pathView;
+        std::string_view _versionView;
         char clientIP[16] = {0};
         char * _temporaryBuffer = nullptr;
         uint32_t _temporaryBufferSize = 0;
         uint32_t _readSoFar = 0;
 
+        // filled by HTTPRouter, names point into the router and values into the request buffer
+        std::string_view _paramNames[HTTP_MAX_ROUTE_PARAMS];
+        std::string_view _paramValues[HTTP_MAX_ROUTE_PARAMS];
+        uint32_t _paramCount = 0;
+
         HTTPHeaders _headers;
         char* _body = nullptr;
         bool _bodyComplete = false;
+        bool _keepAlive = false;
 
         int32_t _clientSocket = 0;
         sockaddr_in _clientAddress = {};
@@ -156,47 +640,66 @@ namespace sp
 
         void __processRequest(char *buffer, uint32_t size)
         {
-            _temporaryBuffer = buffer;
-            _temporaryBufferSize = size;
-            
             int32_t bytesReceived = read(_clientSocket, buffer, size - 1);
             if (bytesReceived == -1)
             {
                 fprintf(stderr, "err:: Failer to receive data from client\n");
                 return;
             }
-            buffer[size] = '\0';
-            char *start = buffer;
-            char *lineend = strstr(buffer, HTTP_HEADER_SEPARATOR);
-            char* body = strstr(buffer, HTTP_SEPARATOR);
-            body = body + 4;
-            char *method = strtok(start, " ");
-            _method = HTTPgetMethod(method);
-            _path = strtok(nullptr, " ");
-            _version = strtok(nullptr, HTTP_SEPARATOR);
-            char *header_token = lineend + 2;
-            _headers.create(header_token);
-            char *cl = _headers.get("Content-Length");
-            if (cl != nullptr)
-            {
-                _contentLength = atoi(cl);
-            }
-            _contentType = _headers.get("Content-Type");
-            _userAgent = _headers.get("User-Agent");
+            __parseRequest(buffer, size, bytesReceived);
+        };
+
+        // parses a request already sitting in buffer, bytesReceived must be < size
+        void __parseRequest(char *buffer, uint32_t size, uint32_t bytesReceived)
+        {
+            HTTPParser parser;
+            if (parser.parse(buffer, bytesReceived) != HTTP_PARSE_DONE)
+                return;
+            __parseRequest(parser, buffer, size, bytesReceived);
+        };
+
+        // builds the request from a finished parse. The delimiter after every token is
+        // overwritten with a terminator so the char* fields point straight into buffer
+        void __parseRequest(const HTTPParser &parser, char *buffer, uint32_t size, uint32_t bytesReceived)
+        {
+            _temporaryBuffer = buffer;
+            _temporaryBufferSize = size;
+            buffer[bytesReceived] = '\0';
+
+            _methodView = parser.view(buffer, parser._method);
+            _pathView = parser.view(buffer, parser._path);
+            _versionView = parser.view(buffer, parser._version);
+            _method = HTTPgetMethod(_methodView);
+            buffer[parser._method.end] = '\0';
+            buffer[parser._path.end] = '\0';
+            buffer[parser._version.end] = '\0';
+            _path = buffer + parser._path.start;
+            _version = buffer + parser._version.start;
 
-            //process body if any content length is unreliable
-            int bodySize = 0;
-            if (body)
+            for (uint32_t i = 0; i < parser._headerCount; ++i)
             {
-                bodySize = strlen(body);
-                _readSoFar = bodySize;
-                if (bodySize > 0)
-                    _body = body;
+                const HTTPParser::Header &header = parser._headers[i];
+                buffer[header.name.end] = '\0';
+                buffer[header.value.end] = '\0';
+                _headers.add(buffer + header.name.start, header.name.end - header.name.start, buffer + header.value.start);
             }
+            _contentLength = parser._contentLength;
+            _contentType = _headers.get(HTTP_HEADER_CONTENT_TYPE);
+            _userAgent = _headers.get(HTTP_HEADER_USER_AGENT);
 
-            _bodyComplete = _contentLength? bodySize <= _contentLength : true;
+            // HTTP/1.1 connections persist unless told otherwise, HTTP/1.0 ones only on request
+            char *connection = _headers.get(HTTP_HEADER_CONNECTION);
+            _keepAlive = _versionView != "HTTP/1.0";
+            if (connection)
+                _keepAlive = _keepAlive ? strcasestr(connection, "close") == nullptr : strcasestr(connection, "keep-alive") != nullptr;
 
-            printf("%.7s [ %5.2f kb ]-> %s\n", method, (float)_contentLength / 1024, _path);
+            uint32_t bodySize = bytesReceived - parser._headerLength;
+            _readSoFar = bodySize;
+            if (bodySize > 0)
+                _body = buffer + parser._headerLength;
+            _bodyComplete = bodySize >= _contentLength;
+
+            printf("%.7s [ %5.2f kb ]-> %s\n", buffer + parser._method.start, (float)_contentLength / 1024, _path);
         };
 
         bool readNext()
@@ -268,6 +771,16 @@ namespace sp
             return queryparams;
         };
 
+        std::string_view getParam(std::string_view name) const
+        {
+            for (uint32_t i = 0; i < _paramCount; ++i)
+            {
+                if (_paramNames[i] == name)
+                    return _paramValues[i];
+            }
+            return std::string_view();
+        };
+
         std::unordered_map<char *, char *> getQueryParams()
         {
             char *query = strchr(_path, '?');
@@ -280,11 +793,51 @@ namespace sp
 
     };
 
+    static const char *HTTPstatusText(uint32_t statusCode)
+    {
+        switch (statusCode)
+        {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return statusCode < 400 ? "OK" : "Error";
+        }
+    }
+
     struct HTTPResponse
     {
         char *_responseProcessBuffer = nullptr;
         bool _headerDoneSending = false;
         bool _doneSending = false;
+        bool _keepAlive = false;
+        bool _streaming = false;
+        bool _http10 = false; // HTTP/1.0 peers get close-delimited streams instead of chunks
+        uint32_t _streamBuffered = 0;
         int32_t _clientSocket = 0;
         uint32_t _statusCode = 200;
         uint32_t _contentLength = 0;
@@ -302,59 +855,151 @@ namespace sp
             _headers.set(key, value);
         }
 
-        void send(const char *data, uint32_t size)
+        // the first call sends status line, headers and data with one gathered write, the
+        // body is never copied. Content-Length comes from that call, so a body produced in
+        // several pieces has to use beginStream()/write() instead (send() then acts as write())
+        bool send(const char *data, uint32_t size)
         {
-            char *dp = (char *)data;
-            int writeSize = 0;
-            if (!_headerDoneSending)
+            if (_streaming)
+                return write(data, size);
+            if (_headerDoneSending)
             {
-                writeSize = sprintf(_responseProcessBuffer, "HTTP/1.1 %d OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n", _statusCode, _contentType.c_str(), size);
+                fprintf(stderr, "err:: response already sent, use beginStream() for multi-part bodies\n");
+                return false;
+            }
 
-                writeSize += _headers.print(_responseProcessBuffer + writeSize, _responseProcessingBufferSize - writeSize);
+            char head[HTTP_RESPONSE_HEAD_SIZE];
+            uint32_t headSize = __writeHead(head, sizeof(head), size);
+            _headerDoneSending = true;
+            if (headSize == 0)
+                return false;
+            iovec iov[2] = {{head, headSize}, {(void *)data, size}};
+            return sendAllv(_clientSocket, iov, 2);
+        }
 
-                char *body = _responseProcessBuffer + writeSize;
-                int canWrite = _responseProcessingBufferSize - writeSize;
-                if (size > canWrite)
-                {
-                    memcpy(body, dp, canWrite);
-                    dp += canWrite;
-                    size -= canWrite;
-                    writeSize += canWrite;
-                }
-                else
-                {
-                    memcpy(body, dp, size);
-                    writeSize += size;
-                    size = 0;
-                }
+        // status line and headers into head, 0 if they do not fit; 204 and 304 carry no length
+        uint32_t __writeHead(char *head, uint32_t capacity, uint64_t contentLength)
+        {
+            HTTPHeaderBuilder builder(head, capacity);
+            builder.append("HTTP/1.1 ", 9);
+            builder.appendNumber(_statusCode);
+            builder.append(" ", 1);
+            builder.append(HTTPstatusText(_statusCode));
+            builder.append("\r\nContent-Type: ", 16);
+            builder.append(_contentType);
+            if (_streaming)
+            {
+                if (!_http10)
+                    builder.append("\r\nTransfer-Encoding: chunked", 28);
+            }
+            else if (_statusCode != 204 && _statusCode != 304)
+            {
+                builder.append("\r\nContent-Length: ", 18);
+                builder.appendNumber(contentLength);
+            }
+            builder.append(_keepAlive ? "\r\nConnection: keep-alive\r\n" : "\r\nConnection: close\r\n");
+            _headers.write(builder);
+            builder.append("\r\n", 2);
+            if (builder._overflow)
+            {
+                fprintf(stderr, "err:: response headers exceed %u bytes\n", capacity);
+                return 0;
+            }
+            return builder._size;
+        }
+
+        // headers only, for HEAD requests and bodies that are sent some other way
+        bool sendHeaders(uint64_t contentLength)
+        {
+            if (_headerDoneSending)
+                return false;
+            _headerDoneSending = true;
+            char head[HTTP_RESPONSE_HEAD_SIZE];
+            uint32_t headSize = __writeHead(head, sizeof(head), contentLength);
+            return headSize && sendAll(_clientSocket, head, headSize);
+        }
 
-                _responseProcessBuffer[writeSize] = '\0';
+        // body straight from a file descriptor with sendfile(2), never entering user space
+        bool sendFile(int32_t fd, uint64_t offset, uint64_t size)
+        {
+            if (!sendHeaders(size))
+                return false;
+            return sendFileAll(_clientSocket, fd, offset, size);
+        }
 
-                ::send(_clientSocket, _responseProcessBuffer, writeSize, 0);
-                _headerDoneSending = true;
-                return;
-            }
-            while (size > 0)
+        // starts a body of unknown length sent as Transfer-Encoding: chunked. Writes are
+        // gathered in the worker's response buffer and go out as one chunk per
+        // HTTP_STREAM_CHUNK_SIZE, so memory stays constant however large the body gets
+        bool beginStream()
+        {
+            if (_headerDoneSending)
+                return false;
+            _streaming = true;
+            _streamBuffered = 0;
+            if (_http10)
+                _keepAlive = false; // the end of the body is signalled by closing
+            char head[HTTP_RESPONSE_HEAD_SIZE];
+            uint32_t headSize = __writeHead(head, sizeof(head), 0);
+            _headerDoneSending = true;
+            return headSize && sendAll(_clientSocket, head, headSize);
+        }
+
+        // blocks while the socket buffer is full, which throttles a producer to the client's pace
+        bool write(const char *data, uint32_t size)
+        {
+            if (!_streaming || _doneSending)
+                return false;
+            uint32_t capacity = std::min<uint32_t>(HTTP_STREAM_CHUNK_SIZE, _responseProcessingBufferSize);
+            if (_streamBuffered + size <= capacity)
             {
-                if (size > _responseProcessingBufferSize)
-                {
-                    ::send(_clientSocket, dp, _responseProcessingBufferSize, 0);
-                    dp += _responseProcessingBufferSize;
-                    size -= _responseProcessingBufferSize;
-                }
-                else
-                {
-                    ::send(_clientSocket, dp, size, 0);
-                    size = 0;
-                }
+                memcpy(_responseProcessBuffer + _streamBuffered, data, size);
+                _streamBuffered += size;
+                return _streamBuffered < capacity || flush();
             }
+            // too big to gather: buffered bytes and data leave together as one chunk
+            return __sendChunk(data, size);
+        }
+
+        bool flush()
+        {
+            return !_streaming || _streamBuffered == 0 || __sendChunk(nullptr, 0);
+        }
+
+        // sends what is buffered plus the terminating zero-length chunk
+        bool finish()
+        {
+            if (!_streaming || _doneSending)
+                return false;
+            bool sent = flush();
+            _doneSending = true;
+            if (!_http10)
+                sent = sent && sendAll(_clientSocket, "0\r\n\r\n", 5);
+            return sent;
+        }
+
+        bool __sendChunk(const char *data, uint32_t size)
+        {
+            uint64_t total = (uint64_t)_streamBuffered + size;
+            char prefix[20];
+            uint32_t prefixSize = _http10 ? 0 : snprintf(prefix, sizeof(prefix), "%llx\r\n", (unsigned long long)total);
+            iovec iov[4] = {{prefix, prefixSize},
+                            {_responseProcessBuffer, _streamBuffered},
+                            {(void *)data, size},
+                            {(void *)"\r\n", _http10 ? 0u : 2u}};
+            _streamBuffered = 0;
+            return sendAllv(_clientSocket, iov, 4);
         }
 
+        // completes the response; the socket itself belongs to the server, which either
+        // closes it or keeps it for the next request depending on _keepAlive
         void end()
         {
             if (_clientSocket > 0 && !_doneSending)
             {
-                close(_clientSocket);
+                if (_streaming)
+                    finish();
+                else if (!_headerDoneSending)
+                    send("", 0);
                 _doneSending = true;
             }
         };
@@ -371,28 +1016,389 @@ namespace sp
         };
     };
 
+    // a client socket plus the bytes received on it that have not been answered yet. Reactor
+    // connections own a growable buffer; blocking-mode connections borrow the worker's buffer
+    struct HTTPConnection
+    {
+        int32_t _socket = -1;
+        sockaddr_in _address = {};
+        EventLoop *_loop = nullptr;
+        char *_buffer = nullptr;
+        uint32_t _size = 0;
+        uint32_t _capacity = 0;
+        bool _ownsBuffer = false;
+        bool _peerClosed = false;
+        uint32_t _requestCount = 0;
+        HTTPParser _parser;
+
+        // reactor bookkeeping, only touched by the owning reactor except for _busy/_lastActive
+        HTTPConnection *_prev = nullptr;
+        HTTPConnection *_next = nullptr;
+        std::atomic<bool> _busy = {false};
+        std::atomic<uint64_t> _lastActive = {0};
+
+        bool create(int32_t socket, const sockaddr_in &address, EventLoop *loop)
+        {
+            _socket = socket;
+            _address = address;
+            _loop = loop;
+            _size = 0;
+            _capacity = HTTP_MAX_HEADER_SIZE;
+            _buffer = (char *)malloc(_capacity);
+            _ownsBuffer = true;
+            _parser.reset();
+            return _buffer != nullptr;
+        }
+
+        void attach(int32_t socket, const sockaddr_in &address, char *buffer, uint32_t capacity)
+        {
+            _socket = socket;
+            _address = address;
+            _loop = nullptr;
+            _buffer = buffer;
+            _size = 0;
+            _capacity = capacity;
+            _ownsBuffer = false;
+            _parser.reset();
+        }
+
+        // reads what is available; a reactor connection is drained until it would block,
+        // a blocking one returns after a single read. Returns false once the peer is gone
+        bool fill()
+        {
+            while (true)
+            {
+                if (_size + 1 >= _capacity && !__grow())
+                    return true;
+                ssize_t bytesReceived = ::recv(_socket, _buffer + _size, _capacity - _size - 1, 0);
+                if (bytesReceived > 0)
+                {
+                    _size += bytesReceived;
+                    if (_loop == nullptr)
+                        return true;
+                    continue;
+                }
+                if (bytesReceived == 0)
+                    return false;
+                if (errno == EINTR)
+                    continue;
+                return _loop && (errno == EAGAIN || errno == EWOULDBLOCK);
+            }
+        }
+
+        // size of the first request in the buffer (headers plus declared body), 0 while the
+        // header block is incomplete, HTTP_REQUEST_MALFORMED or HTTP_REQUEST_TOO_LARGE when it
+        // can never be accepted. Only bytes that arrived since the last call are parsed
+        int64_t requestLength()
+        {
+            int32_t result = _parser.parse(_buffer, _size);
+            if (result == HTTP_PARSE_ERROR)
+                return HTTP_REQUEST_MALFORMED;
+            if (result == HTTP_PARSE_INCOMPLETE)
+                return _size + 1 >= HTTP_MAX_HEADER_SIZE ? HTTP_REQUEST_TOO_LARGE : 0;
+
+            uint64_t total = _parser._headerLength + _parser._contentLength;
+            if (_ownsBuffer && total + 1 > HTTP_MAX_REQUEST_SIZE)
+                return HTTP_REQUEST_TOO_LARGE;
+            return (int64_t)total;
+        }
+
+        // drops an answered request, moving any pipelined bytes behind it to the front
+        void consume(uint32_t length)
+        {
+            length = std::min(length, _size);
+            memmove(_buffer, _buffer + length, _size - length);
+            _size -= length;
+            _parser.reset();
+        }
+
+        void destroy()
+        {
+            if (_socket > 0)
+            {
+                close(_socket);
+                _socket = -1;
+            }
+            if (_ownsBuffer)
+                free(_buffer);
+            _buffer = nullptr;
+        }
+
+        bool __grow()
+        {
+            if (!_ownsBuffer || _capacity >= HTTP_MAX_REQUEST_SIZE)
+                return false;
+            uint32_t capacity = std::min<uint32_t>(_capacity * 2, HTTP_MAX_REQUEST_SIZE);
+            char *buffer = (char *)realloc(_buffer, capacity);
+            if (buffer == nullptr)
+                return false;
+            _buffer = buffer;
+            _capacity = capacity;
+            return true;
+        }
+    };
+
+    // a reactor's epoll instance and the connections it accepted; connections are only
+    // ever freed by their reactor thread
+    struct HTTPReactor
+    {
+        EventLoop _eventLoop;
+        HTTPConnection *_connections = nullptr;
+
+        void link(HTTPConnection *connection)
+        {
+            connection->_prev = nullptr;
+            connection->_next = _connections;
+            if (_connections)
+                _connections->_prev = connection;
+            _connections = connection;
+        }
+
+        void unlink(HTTPConnection *connection)
+        {
+            if (connection->_prev)
+                connection->_prev->_next = connection->_next;
+            else
+                _connections = connection->_next;
+            if (connection->_next)
+                connection->_next->_prev = connection->_prev;
+        }
+    };
+
+    typedef std::function<void(HTTPRequest &, HTTPResponse &)> HTTPHandler;
+
+    // routes compiled into a radix tree. Static runs of a pattern share prefixes, ":name"
+    // captures one path segment and "*name" captures the rest of the path. Matching walks
+    // the path once, trying static edges before a parameter and a parameter before a
+    // wildcard, so cost follows the path length rather than the number of routes
+    struct HTTPRouter
+    {
+        struct Node
+        {
+            std::string _prefix;
+            std::string _indices; // first byte of each static child, same order as _children
+            std::vector<std::unique_ptr<Node>> _children;
+            std::unique_ptr<Node> _param;
+            std::unique_ptr<Node> _wildcard;
+            std::string _name; // capture name for _param / _wildcard nodes
+            HTTPHandler _handlers[HTTP_METHOD_COUNT];
+            bool _hasHandler = false;
+        };
+
+        Node _root;
+        uint32_t _routeCount = 0;
+
+        bool add(uint32_t method, std::string_view pattern, HTTPHandler handler)
+        {
+            if (method >= HTTP_METHOD_COUNT || pattern.empty() || pattern[0] != '/')
+            {
+                fprintf(stderr, "err:: invalid route %.*s\n", (int)pattern.size(), pattern.data());
+                return false;
+            }
+
+            Node *node = &_root;
+            uint32_t params = 0;
+            while (!pattern.empty())
+            {
+                size_t special = pattern.find_first_of(":*");
+                node = __insertStatic(node, pattern.substr(0, special));
+                if (special == std::string_view::npos)
+                    break;
+
+                pattern = pattern.substr(special);
+                size_t end = pattern.find('/');
+                std::string_view name = pattern.substr(1, end == std::string_view::npos ? end : end - 1);
+                bool wildcard = pattern[0] == '*';
+                if (name.empty() || ++params > HTTP_MAX_ROUTE_PARAMS || (wildcard && end != std::string_view::npos))
+                {
+                    fprintf(stderr, "err:: invalid route parameter in %.*s\n", (int)pattern.size(), pattern.data());
+                    return false;
+                }
+                std::unique_ptr<Node> &child = wildcard ? node->_wildcard : node->_param;
+                if (!child)
+                {
+                    child.reset(new Node());
+                    child->_name = std::string(name);
+                }
+                else if (child->_name != name)
+                {
+                    fprintf(stderr, "err:: conflicting parameter names :%s and :%.*s\n", child->_name.c_str(), (int)name.size(), name.data());
+                    return false;
+                }
+                node = child.get();
+                pattern = end == std::string_view::npos ? std::string_view() : pattern.substr(end);
+            }
+
+            if (!node->_handlers[method])
+                _routeCount++;
+            node->_handlers[method] = std::move(handler);
+            node->_hasHandler = true;
+            return true;
+        }
+
+        bool get(std::string_view pattern, HTTPHandler handler) { return add(HTTP_METHOD_GET, pattern, std::move(handler)); }
+        bool post(std::string_view pattern, HTTPHandler handler) { return add(HTTP_METHOD_POST, pattern, std::move(handler)); }
+        bool put(std::string_view pattern, HTTPHandler handler) { return add(HTTP_METHOD_PUT, pattern, std::move(handler)); }
+        bool del(std::string_view pattern, HTTPHandler handler) { return add(HTTP_METHOD_DELETE, pattern, std::move(handler)); }
+
+        bool empty() const
+        {
+            return _routeCount == 0;
+        }
+
+        // handler for method + path (query string ignored), captures go into request. When the
+        // path exists under other methods only, methodMismatch is set and nullptr returned
+        const HTTPHandler *match(uint32_t method, std::string_view path, HTTPRequest &request, bool &methodMismatch) const
+        {
+            size_t query = path.find('?');
+            if (query != std::string_view::npos)
+                path = path.substr(0, query);
+            methodMismatch = false;
+            request._paramCount = 0;
+            const Node *node = __match(&_root, path, request);
+            if (node == nullptr)
+                return nullptr;
+            if (method >= HTTP_METHOD_COUNT || !node->_handlers[method])
+            {
+                methodMismatch = true;
+                return nullptr;
+            }
+            return &node->_handlers[method];
+        }
+
+        // answers the request from the table, 404/405 when nothing matches
+        bool dispatch(HTTPRequest &request, HTTPResponse &response) const;
+
+        Node *__insertStatic(Node *node, std::string_view path)
+        {
+            while (!path.empty())
+            {
+                size_t index = node->_indices.find(path[0]);
+                if (index == std::string::npos)
+                {
+                    Node *child = new Node();
+                    child->_prefix = std::string(path);
+                    node->_indices.push_back(path[0]);
+                    node->_children.emplace_back(child);
+                    return child;
+                }
+
+                Node *child = node->_children[index].get();
+                size_t common = 0;
+                while (common < path.size() && common < child->_prefix.size() && path[common] == child->_prefix[common])
+                    common++;
+                if (common < child->_prefix.size())
+                {
+                    // split the edge so the shared part becomes its own node
+                    Node *split = new Node();
+                    split->_prefix = child->_prefix.substr(0, common);
+                    child->_prefix.erase(0, common);
+                    split->_indices.push_back(child->_prefix[0]);
+                    split->_children.emplace_back(node->_children[index].release());
+                    node->_children[index].reset(split);
+                    child = split;
+                }
+                node = child;
+                path = path.substr(common);
+            }
+            return node;
+        }
+
+        static const Node *__match(const Node *node, std::string_view path, HTTPRequest &request)
+        {
+            if (path.empty() && node->_hasHandler)
+                return node;
+
+            if (!path.empty())
+            {
+                size_t index = node->_indices.find(path[0]);
+                if (index != std::string::npos)
+                {
+                    const Node *child = node->_children[index].get();
+                    if (path.compare(0, child->_prefix.size(), child->_prefix) == 0)
+                    {
+                        const Node *found = __match(child, path.substr(child->_prefix.size()), request);
+                        if (found)
+                            return found;
+                    }
+                }
+
+                if (node->_param && path[0] != '/')
+                {
+                    size_t end = std::min(path.find('/'), path.size());
+                    uint32_t mark = request._paramCount++;
+                    request._paramNames[mark] = node->_param->_name;
+                    request._paramValues[mark] = path.substr(0, end);
+                    const Node *found = __match(node->_param.get(), path.substr(end), request);
+                    if (found)
+                        return found;
+                    request._paramCount = mark;
+                }
+            }
+
+            if (node->_wildcard && node->_wildcard->_hasHandler)
+            {
+                request._paramNames[request._paramCount] = node->_wildcard->_name;
+                request._paramValues[request._paramCount++] = path;
+                return node->_wildcard.get();
+            }
+            return nullptr;
+        }
+    };
+
+    inline bool HTTPRouter::dispatch(HTTPRequest &request, HTTPResponse &response) const
+    {
+        bool methodMismatch = false;
+        const HTTPHandler *handler = match(request._method, request._pathView, request, methodMismatch);
+        if (handler)
+        {
+            (*handler)(request, response);
+            return true;
+        }
+        response.setStatus(methodMismatch ? 405 : 404);
+        response.send("", 0);
+        return false;
+    }
+
     struct HTTPJob
     {
         HTTPRequest request;
         HTTPResponse response;
+        HTTPConnection *connection = nullptr;
     };
 
+    static uint64_t __httpNow()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+    }
+
     struct HTTPServer
     {
         Server _server;
         ThreadPool<HTTPJob> _threadpool;
-        std::function<void(HTTPRequest &, HTTPResponse &)> _routerFunction = nullptr;
+        std::function<void(HTTPRequest &, HTTPResponse &)> _routerFunction = nullptr; // used when _router is empty
+        HTTPRouter _router;
+        uint32_t _mode = HTTP_SERVER_BLOCKING;
+        uint32_t _reactorCount = std::thread::hardware_concurrency();
+        uint32_t _keepAliveTimeout = HTTP_KEEP_ALIVE_TIMEOUT;
+        uint32_t _maxRequestsPerConnection = HTTP_KEEP_ALIVE_MAX_REQUESTS;
+        std::vector<HTTPReactor> _loops;
+        std::vector<std::thread> _reactors;
+        volatile bool _running = false;
 
-        bool create(uint16_t port, uint32_t threadCount = std::thread::hardware_concurrency())
+        bool create(uint16_t port, uint32_t threadCount = std::thread::hardware_concurrency(), uint32_t mode = HTTP_SERVER_BLOCKING)
         {
+            _mode = mode;
             sp::ServerConfig config;
             config.port = port;
             if (!_server.create(config))
                 return false;
 
-            if (!_routerFunction)
+            if (!_routerFunction && _router.empty())
             {
-                fprintf(stderr, "err:: router function not set\n");
+                fprintf(stderr, "err:: no routes or router function set\n");
                 return false;
             }
 
@@ -416,20 +1422,39 @@ namespace sp
 
             _threadpool.create([&](HTTPJob &job, const std::vector<void *> &dataPtrs)
                                {
-                    char *buffer = (char *)(dataPtrs[0]);
-                    job.request.__processRequest(buffer, HTTP_MAX_HEADER_SIZE - 1);
-                    char * responseBuffer = (char *)(dataPtrs[1]);
-                    job.response._responseProcessBuffer = responseBuffer;
-                    job.response._responseProcessingBufferSize = HTTP_RESPONSE_BUFFER_SIZE -1;
-                    _routerFunction(job.request, job.response);
-                    job.response.end(); },
+                    char *responseBuffer = (char *)(dataPtrs[1]);
+                    HTTPConnection *connection = job.connection;
+                    if (connection)
+                    {
+                        __releaseConnection(connection, __serveConnection(*connection, responseBuffer));
+                        return;
+                    }
+
+                    // blocking mode: the worker's request buffer is reused for every request on the socket
+                    HTTPConnection blocking;
+                    blocking.attach(job.request._clientSocket, job.request._clientAddress, (char *)(dataPtrs[0]), HTTP_MAX_HEADER_SIZE);
+                    timeval timeout = {(time_t)_keepAliveTimeout, 0};
+                    setsockopt(blocking._socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                    __serveConnection(blocking, responseBuffer);
+                    blocking.destroy(); },
                                threadCount);
             return true;
         };
 
         void destroy()
         {
+            _running = false;
+            for (auto &reactor : _reactors)
+                reactor.join();
+            _reactors.clear();
             _threadpool.destroy();
+            for (auto &loop : _loops)
+            {
+                while (loop._connections)
+                    __dropConnection(loop, loop._connections);
+                loop._eventLoop.destroy();
+            }
+            _loops.clear();
             _server.destroy();
         };
 
@@ -437,7 +1462,13 @@ namespace sp
         {
             _server.start();
             printf("server started successfully.\n");
-            while (true)
+            _running = true;
+            if (_mode == HTTP_SERVER_REACTOR)
+            {
+                __listenReactor();
+                return;
+            }
+            while (_running)
             {
                 int32_t clientSocket = 0;
                 sockaddr_in clientAddress = {};
@@ -450,6 +1481,205 @@ namespace sp
                 }
             }
         };
+
+        // answers every complete request in the connection buffer in order. Blocking
+        // connections read until the client goes idle; reactor connections return as soon
+        // as the buffer runs dry. Returns whether the connection should stay open
+        bool __serveConnection(HTTPConnection &connection, char *responseBuffer)
+        {
+            while (true)
+            {
+                int64_t length = connection.requestLength();
+                if (length < 0)
+                {
+                    __rejectRequest(connection._socket, length);
+                    return false;
+                }
+
+                // a body larger than the worker buffer is left on the socket for readNext
+                bool oversized = connection._loop == nullptr && length + 1 > connection._capacity && connection._size + 1 >= connection._capacity;
+                if (length == 0 || (length > connection._size && !oversized))
+                {
+                    if (connection._loop)
+                        return !connection._peerClosed;
+                    if (connection._size == 0 && connection._requestCount > 0 && !_running)
+                        return false;
+                    if (!connection.fill())
+                        return false;
+                    continue;
+                }
+
+                uint32_t requestSize = oversized ? connection._size : (uint32_t)length;
+                char next = connection._buffer[requestSize];
+
+                HTTPJob job;
+                job.request.create(connection._socket, connection._address);
+                job.response.create(connection._socket);
+                job.request.__parseRequest(connection._parser, connection._buffer, connection._capacity, requestSize);
+                job.response._responseProcessBuffer = responseBuffer;
+                job.response._responseProcessingBufferSize = HTTP_RESPONSE_BUFFER_SIZE - 1;
+
+                job.response._http10 = job.request._versionView == "HTTP/1.0";
+
+                connection._requestCount++;
+                job.response._keepAlive = job.request._keepAlive && !oversized && _running && !connection._peerClosed &&
+                                          connection._requestCount < _maxRequestsPerConnection;
+                if (_router.empty())
+                    _routerFunction(job.request, job.response);
+                else
+                    _router.dispatch(job.request, job.response);
+                job.response.end();
+                job.response._keepAlive = job.response._keepAlive && !(job.response._streaming && job.response._http10);
+
+                if (!job.response._keepAlive)
+                    return false;
+                connection._buffer[requestSize] = next;
+                connection.consume(requestSize);
+            }
+        };
+
+        // one reactor per core, all sharing the listening socket; EPOLLEXCLUSIVE keeps
+        // a new connection from waking every reactor at once
+        void __listenReactor()
+        {
+            if (!setNonBlocking(_server._socket))
+            {
+                fprintf(stderr, "err:: unable to make listening socket non-blocking\n");
+                return;
+            }
+            uint32_t reactorCount = _reactorCount ? _reactorCount : 1;
+            _loops = std::vector<HTTPReactor>(reactorCount);
+            for (auto &loop : _loops)
+            {
+                if (!loop._eventLoop.create() || !loop._eventLoop.add(_server._socket, EPOLLIN | EPOLLEXCLUSIVE, nullptr))
+                {
+                    fprintf(stderr, "err:: unable to register listening socket with reactor\n");
+                    return;
+                }
+            }
+            for (uint32_t i = 1; i < reactorCount; ++i)
+                _reactors.emplace_back([this, i]
+                                       { __runReactor(_loops[i]); });
+            __runReactor(_loops[0]);
+        };
+
+        void __runReactor(HTTPReactor &loop)
+        {
+            epoll_event events[HTTP_REACTOR_MAX_EVENTS];
+            uint64_t lastSweep = __httpNow();
+            while (_running)
+            {
+                int32_t count = loop._eventLoop.wait(events, HTTP_REACTOR_MAX_EVENTS, 1000);
+                for (int32_t i = 0; i < count; ++i)
+                {
+                    if (events[i].data.ptr == nullptr)
+                    {
+                        __acceptConnections(loop);
+                        continue;
+                    }
+                    HTTPConnection *connection = (HTTPConnection *)events[i].data.ptr;
+                    connection->_lastActive = __httpNow();
+                    bool peerOpen = !(events[i].events & EPOLLERR) && connection->fill() && !(events[i].events & EPOLLHUP);
+                    if (!peerOpen)
+                    {
+                        // a half-closed client may still be owed answers for what it sent
+                        int64_t length = connection->requestLength();
+                        if (connection->_peerClosed || length <= 0 || length > connection->_size)
+                        {
+                            __dropConnection(loop, connection);
+                            continue;
+                        }
+                        connection->_peerClosed = true;
+                    }
+                    __dispatchConnection(loop, connection);
+                }
+
+                uint64_t now = __httpNow();
+                if (now - lastSweep >= 1000)
+                {
+                    __sweepIdleConnections(loop, now);
+                    lastSweep = now;
+                }
+            }
+        };
+
+        void __acceptConnections(HTTPReactor &loop)
+        {
+            int32_t clientSocket = 0;
+            sockaddr_in clientAddress = {};
+            while (_server.acceptClient(clientSocket, clientAddress, true))
+            {
+                HTTPConnection *connection = new HTTPConnection();
+                loop.link(connection);
+                connection->_lastActive = __httpNow();
+                if (!connection->create(clientSocket, clientAddress, &loop._eventLoop) ||
+                    !loop._eventLoop.add(clientSocket, EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT, connection))
+                {
+                    __dropConnection(loop, connection);
+                }
+            }
+        };
+
+        // hands the connection to a worker once a full request is buffered, the socket stays
+        // disarmed (EPOLLONESHOT) while the worker owns it
+        void __dispatchConnection(HTTPReactor &loop, HTTPConnection *connection)
+        {
+            int64_t length = connection->requestLength();
+            if (length == 0 || length > connection->_size)
+            {
+                if (!connection->_loop->modify(connection->_socket, EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT, connection))
+                    __dropConnection(loop, connection);
+                return;
+            }
+            if (length < 0)
+            {
+                __rejectRequest(connection->_socket, length);
+                __dropConnection(loop, connection);
+                return;
+            }
+            connection->_busy = true;
+            HTTPJob job;
+            job.connection = connection;
+            _threadpool.push(std::move(job));
+        };
+
+        // called by the worker when it is done with a reactor connection; a connection that
+        // should close is shut down and re-armed so its reactor sees the hangup and frees it
+        void __releaseConnection(HTTPConnection *connection, bool keepOpen)
+        {
+            if (!keepOpen)
+                shutdown(connection->_socket, SHUT_RDWR);
+            connection->_lastActive = __httpNow();
+            connection->_busy = false;
+            connection->_loop->modify(connection->_socket, EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT, connection);
+        };
+
+        // idle persistent connections are shut down rather than freed here, their reactor
+        // frees them through the normal hangup path
+        void __sweepIdleConnections(HTTPReactor &loop, uint64_t now)
+        {
+            uint64_t timeout = _keepAliveTimeout * 1000ull;
+            for (HTTPConnection *connection = loop._connections; connection; connection = connection->_next)
+            {
+                if (!connection->_busy && now - connection->_lastActive >= timeout)
+                    shutdown(connection->_socket, SHUT_RDWR);
+            }
+        };
+
+        void __rejectRequest(int32_t socket, int64_t reason)
+        {
+            const char *response = reason == HTTP_REQUEST_TOO_LARGE
+                                       ? "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+                                       : "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            sendAll(socket, response, strlen(response));
+        };
+
+        void __dropConnection(HTTPReactor &loop, HTTPConnection *connection)
+        {
+            loop.unlink(connection);
+            connection->destroy();
+            delete connection;
+        };
     };
 
 
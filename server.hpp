@@ -8,9 +8,136 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#ifndef SERVER_SEND_TIMEOUT
+#define SERVER_SEND_TIMEOUT 30 * 1000  // ms a send may wait for a full socket buffer to drain
+#endif
 
 namespace sp {
 
+    static bool setNonBlocking(int32_t socket, bool nonBlocking = true)
+    {
+        int32_t flags = fcntl(socket, F_GETFL, 0);
+        if(flags < 0)
+            return false;
+        flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        return fcntl(socket, F_SETFL, flags) == 0;
+    }
+
+    // blocks until a full socket buffer drains again, this is where slow readers push back
+    // on writers. Gives up after SERVER_SEND_TIMEOUT milliseconds without progress
+    static bool waitWritable(int32_t socket)
+    {
+        pollfd pfd = {socket, POLLOUT, 0};
+        while(true)
+        {
+            int32_t ready = poll(&pfd, 1, SERVER_SEND_TIMEOUT);
+            if(ready < 0 && errno == EINTR)
+                continue;
+            return ready > 0 && !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL));
+        }
+    }
+
+    // writes the whole buffer, retrying on short writes and waiting for the
+    // socket to drain when a non-blocking socket returns EAGAIN
+    static bool sendAll(int32_t socket, const char * data, uint64_t size)
+    {
+        while(size > 0)
+        {
+            ssize_t sent = ::send(socket, data, size, MSG_NOSIGNAL);
+            if(sent < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if(!waitWritable(socket))
+                        return false;
+                    continue;
+                }
+                return false;
+            }
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    // gathers count buffers into as few sendmsg calls as the socket allows. On a short
+    // write the iovecs are advanced in place (so they are consumed by the call)
+    static bool sendAllv(int32_t socket, iovec * iov, int32_t count)
+    {
+        while(count > 0 && iov->iov_len == 0)
+        {
+            iov++;
+            count--;
+        }
+        while(count > 0)
+        {
+            msghdr message = {};
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+            ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+            if(sent < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if(!waitWritable(socket))
+                        return false;
+                    continue;
+                }
+                return false;
+            }
+            while(count > 0 && (size_t)sent >= iov->iov_len)
+            {
+                sent -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if(count > 0)
+            {
+                iov->iov_base = (char *)iov->iov_base + sent;
+                iov->iov_len -= sent;
+            }
+        }
+        return true;
+    }
+
+    // streams size bytes of a file to the socket from the kernel page cache, handling short
+    // writes and EAGAIN the same way sendAll does
+    static bool sendFileAll(int32_t socket, int32_t fd, uint64_t offset, uint64_t size)
+    {
+        off_t position = offset;
+        while(size > 0)
+        {
+            ssize_t sent = sendfile(socket, fd, &position, size);
+            if(sent < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if(!waitWritable(socket))
+                        return false;
+                    continue;
+                }
+                return false;
+            }
+            if(sent == 0)
+                return false;
+            size -= sent;
+        }
+        return true;
+    }
+
     struct ServerConfig
     {
         uint32_t domain = AF_INET;
@@ -68,12 +195,16 @@ namespace sp {
             }                                 
         }
 
-        bool acceptClient(int32_t & clientSocket, sockaddr_in & clientAddress)
+        // with nonBlocking set the listening socket is expected to be non-blocking too;
+        // returning false then simply means there is nothing left to accept
+        bool acceptClient(int32_t & clientSocket, sockaddr_in & clientAddress, bool nonBlocking = false)
         {
             socklen_t clientAddressLength = sizeof(sockaddr_in);
-            clientSocket = accept(_socket, (sockaddr *)&clientAddress, &clientAddressLength);
+            clientSocket = accept4(_socket, (sockaddr *)&clientAddress, &clientAddressLength, nonBlocking ? SOCK_NONBLOCK : 0);
             if(clientSocket < 0)
             {
+                if(nonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return false;
                 fprintf(_logStream, "err:: unable to accept client\n");
                 return false;
             }
@@ -102,6 +233,61 @@ namespace sp {
     };
 
 
+    struct EventLoop
+    {
+        FILE * _logStream = stdout;
+        int32_t _epoll = -1;
+
+        bool create()
+        {
+            _epoll = epoll_create1(EPOLL_CLOEXEC);
+            if(_epoll < 0)
+            {
+                fprintf(_logStream, "err:: unable to create epoll instance\n");
+                return false;
+            }
+            return true;
+        }
+
+        bool add(int32_t socket, uint32_t events, void * data)
+        {
+            epoll_event event = {};
+            event.events = events;
+            event.data.ptr = data;
+            return epoll_ctl(_epoll, EPOLL_CTL_ADD, socket, &event) == 0;
+        }
+
+        bool modify(int32_t socket, uint32_t events, void * data)
+        {
+            epoll_event event = {};
+            event.events = events;
+            event.data.ptr = data;
+            return epoll_ctl(_epoll, EPOLL_CTL_MOD, socket, &event) == 0;
+        }
+
+        bool remove(int32_t socket)
+        {
+            return epoll_ctl(_epoll, EPOLL_CTL_DEL, socket, nullptr) == 0;
+        }
+
+        int32_t wait(epoll_event * events, int32_t maxEvents, int32_t timeoutMs = -1)
+        {
+            int32_t count = epoll_wait(_epoll, events, maxEvents, timeoutMs);
+            if(count < 0 && errno != EINTR)
+                fprintf(_logStream, "err:: epoll wait failed\n");
+            return count < 0 ? 0 : count;
+        }
+
+        void destroy()
+        {
+            if(_epoll >= 0) {
+                close(_epoll);
+                _epoll = -1;
+            }
+        }
+    };
+
+
     struct Client
     {
         FILE * _logStream = stdout;
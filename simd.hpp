@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SP_SIMD_X86 1
+#endif
+
+namespace sp
+{
+
+    constexpr const uint32_t SIMD_SCALAR = 0;
+    constexpr const uint32_t SIMD_SSE42 = 1;
+    constexpr const uint32_t SIMD_AVX2 = 2;
+
+    // best instruction set the running cpu supports, detected once through cpuid
+    static uint32_t simdLevel()
+    {
+#ifdef SP_SIMD_X86
+        static const uint32_t level = __builtin_cpu_supports("avx2")     ? SIMD_AVX2
+                                      : __builtin_cpu_supports("sse4.2") ? SIMD_SSE42
+                                                                         : SIMD_SCALAR;
+        return level;
+#else
+        return SIMD_SCALAR;
+#endif
+    }
+
+    static const char *__findAnyScalar(const char *begin, const char *end, char a, char b, char c, char d)
+    {
+        for (; begin < end; ++begin)
+        {
+            char x = *begin;
+            if (x == a || x == b || x == c || x == d)
+                return begin;
+        }
+        return end;
+    }
+
+#ifdef SP_SIMD_X86
+    __attribute__((target("sse4.2"))) static const char *__findAnySSE42(const char *begin, const char *end, char a, char b, char c, char d)
+    {
+        const __m128i set = _mm_setr_epi8(a, b, c, d, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        for (; begin + 16 <= end; begin += 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *)begin);
+            int32_t index = _mm_cmpestri(set, 4, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+            if (index < 16)
+                return begin + index;
+        }
+        return __findAnyScalar(begin, end, a, b, c, d);
+    }
+
+    __attribute__((target("avx2,bmi"))) static const char *__findAnyAVX2(const char *begin, const char *end, char a, char b, char c, char d)
+    {
+        const __m256i va = _mm256_set1_epi8(a);
+        const __m256i vb = _mm256_set1_epi8(b);
+        const __m256i vc = _mm256_set1_epi8(c);
+        const __m256i vd = _mm256_set1_epi8(d);
+        for (; begin + 32 <= end; begin += 32)
+        {
+            __m256i block = _mm256_loadu_si256((const __m256i *)begin);
+            __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, va), _mm256_cmpeq_epi8(block, vb)),
+                                           _mm256_or_si256(_mm256_cmpeq_epi8(block, vc), _mm256_cmpeq_epi8(block, vd)));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits);
+            if (mask)
+                return begin + _tzcnt_u32(mask);
+        }
+        return __findAnySSE42(begin, end, a, b, c, d);
+    }
+#endif
+
+    // first byte in [begin, end) equal to any of a, b, c or d (repeat a byte to look for
+    // fewer), end when there is none. Never reads past end
+    static const char *findAny(const char *begin, const char *end, char a, char b, char c, char d)
+    {
+#ifdef SP_SIMD_X86
+        typedef const char *(*FindAny)(const char *, const char *, char, char, char, char);
+        static const FindAny dispatch = simdLevel() == SIMD_AVX2    ? __findAnyAVX2
+                                        : simdLevel() == SIMD_SSE42 ? __findAnySSE42
+                                                                    : __findAnyScalar;
+        return dispatch(begin, end, a, b, c, d);
+#else
+        return __findAnyScalar(begin, end, a, b, c, d);
+#endif
+    }
+
+}; // namespace sp
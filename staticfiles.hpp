@@ -0,0 +1,317 @@
+#pragma once
+#include "http.hpp"
+#include "datetime.hpp"
+#include <list>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef HTTP_STATIC_CACHE_SIZE
+#define HTTP_STATIC_CACHE_SIZE 64 * 1024 * 1024   // 64MB of mapped files
+#endif
+#ifndef HTTP_STATIC_CACHE_FILE_SIZE
+#define HTTP_STATIC_CACHE_FILE_SIZE 256 * 1024    // larger files always go through sendfile
+#endif
+#ifndef HTTP_STATIC_REVALIDATE_MS
+#define HTTP_STATIC_REVALIDATE_MS 1000            // how long a cached file is trusted without a stat
+#endif
+
+namespace sp
+{
+
+    static const char *HTTPmimeType(std::string_view path)
+    {
+        size_t dot = path.rfind('.');
+        if (dot == std::string_view::npos)
+            return "application/octet-stream";
+        std::string_view ext = path.substr(dot + 1);
+        if (ext == "html" || ext == "htm")
+            return "text/html; charset=utf-8";
+        if (ext == "css")
+            return "text/css; charset=utf-8";
+        if (ext == "js" || ext == "mjs")
+            return "text/javascript; charset=utf-8";
+        if (ext == "json")
+            return "application/json";
+        if (ext == "txt")
+            return "text/plain; charset=utf-8";
+        if (ext == "svg")
+            return "image/svg+xml";
+        if (ext == "png")
+            return "image/png";
+        if (ext == "jpg" || ext == "jpeg")
+            return "image/jpeg";
+        if (ext == "gif")
+            return "image/gif";
+        if (ext == "webp")
+            return "image/webp";
+        if (ext == "ico")
+            return "image/x-icon";
+        if (ext == "woff2")
+            return "font/woff2";
+        if (ext == "woff")
+            return "font/woff";
+        if (ext == "wasm")
+            return "application/wasm";
+        if (ext == "pdf")
+            return "application/pdf";
+        return "application/octet-stream";
+    }
+
+    // what a response needs to know about a file; cached entries also hold the mapping
+    struct HTTPStaticFile
+    {
+        void *_data = nullptr;
+        uint64_t _size = 0;
+        time_t _modified = 0;
+        int64_t _modifiedNs = 0;
+        const char *_contentType = nullptr;
+        char _etag[48] = {0};
+        char _lastModified[32] = {0};
+        std::atomic<uint64_t> _checkedAt = {0};
+
+        void describe(const struct stat &info, std::string_view path)
+        {
+            _size = info.st_size;
+            _modified = info.st_mtim.tv_sec;
+            _modifiedNs = info.st_mtim.tv_nsec;
+            _contentType = HTTPmimeType(path);
+            snprintf(_etag, sizeof(_etag), "\"%llx-%llx%llx\"", (unsigned long long)_size,
+                     (unsigned long long)_modified, (unsigned long long)_modifiedNs);
+            std::string lastModified = HTTPDateString(_modified);
+            snprintf(_lastModified, sizeof(_lastModified), "%s", lastModified.c_str());
+        }
+
+        bool matches(const struct stat &info) const
+        {
+            return (uint64_t)info.st_size == _size && info.st_mtim.tv_sec == _modified && info.st_mtim.tv_nsec == _modifiedNs;
+        }
+
+        ~HTTPStaticFile()
+        {
+            if (_data)
+                munmap(_data, _size);
+        }
+    };
+
+    // serves files below a root directory. Small files are kept mmap-ed in an LRU cache and
+    // sent from there; everything else goes through sendfile(2). Responses carry ETag and
+    // Last-Modified and conditional GETs are answered with 304
+    struct HTTPStaticFiles
+    {
+        typedef std::list<std::pair<std::string, std::shared_ptr<HTTPStaticFile>>> LRUList;
+
+        std::string _root;
+        uint64_t _cacheLimit = HTTP_STATIC_CACHE_SIZE;
+        uint64_t _cacheFileLimit = HTTP_STATIC_CACHE_FILE_SIZE;
+        uint64_t _cachedBytes = 0;
+        std::mutex _mutex;
+        LRUList _lru; // most recently used first
+        std::unordered_map<std::string, LRUList::iterator> _index;
+
+        bool create(const char *root)
+        {
+            char *resolved = realpath(root, nullptr);
+            struct stat info;
+            if (resolved == nullptr || stat(resolved, &info) != 0 || !S_ISDIR(info.st_mode))
+            {
+                fprintf(stderr, "err:: static root %s is not a directory\n", root);
+                free(resolved);
+                return false;
+            }
+            _root = resolved;
+            free(resolved);
+            return true;
+        }
+
+        void destroy()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _index.clear();
+            _lru.clear();
+            _cachedBytes = 0;
+        }
+
+        // answers the request with the file at relativePath (e.g. the "*path" capture of a
+        // route), returns false when there is no such file and a 404 was sent instead
+        bool serve(HTTPRequest &request, HTTPResponse &response, std::string_view relativePath)
+        {
+            std::string path;
+            if (!__resolve(relativePath, path))
+                return __notFound(response);
+
+            std::shared_ptr<HTTPStaticFile> file = __lookup(path);
+            if (file)
+                return __respond(request, response, *file, -1);
+
+            int32_t fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+            {
+                if (fd >= 0)
+                    close(fd);
+                return __notFound(response);
+            }
+
+            if (info.st_size > 0 && (uint64_t)info.st_size <= _cacheFileLimit)
+            {
+                file = __insert(path, fd, info);
+                if (file)
+                {
+                    close(fd);
+                    return __respond(request, response, *file, -1);
+                }
+            }
+
+            HTTPStaticFile uncached;
+            uncached.describe(info, path);
+            bool sent = __respond(request, response, uncached, fd);
+            close(fd);
+            return sent;
+        }
+
+        bool __respond(HTTPRequest &request, HTTPResponse &response, const HTTPStaticFile &file, int32_t fd)
+        {
+            response._contentType = file._contentType;
+            response.setHeader((char *)"ETag", (char *)file._etag);
+            response.setHeader((char *)"Last-Modified", (char *)file._lastModified);
+
+            if (__notModified(request, file))
+            {
+                response.setStatus(304);
+                return response.sendHeaders(0);
+            }
+            response.setStatus(200);
+            if (request._method == HTTP_METHOD_HEAD)
+                return response.sendHeaders(file._size);
+            if (fd >= 0)
+                return response.sendFile(fd, 0, file._size);
+            response.send((const char *)file._data, file._size);
+            return true;
+        }
+
+        static bool __notModified(HTTPRequest &request, const HTTPStaticFile &file)
+        {
+            if (request._method != HTTP_METHOD_GET && request._method != HTTP_METHOD_HEAD)
+                return false;
+            char *ifNoneMatch = request._headers.get(HTTP_HEADER_IF_NONE_MATCH);
+            if (ifNoneMatch)
+                return strcmp(ifNoneMatch, "*") == 0 || strstr(ifNoneMatch, file._etag) != nullptr;
+            char *ifModifiedSince = request._headers.get(HTTP_HEADER_IF_MODIFIED_SINCE);
+            if (ifModifiedSince)
+            {
+                time_t since = HTTPDateToTimestamp(ifModifiedSince);
+                return since != -1 && file._modified <= since;
+            }
+            return false;
+        }
+
+        static bool __notFound(HTTPResponse &response)
+        {
+            response.setStatus(404);
+            response.send("", 0);
+            return false;
+        }
+
+        // joins the request path onto the root, refusing anything that could climb out of it
+        bool __resolve(std::string_view relativePath, std::string &path) const
+        {
+            while (!relativePath.empty() && relativePath[0] == '/')
+                relativePath.remove_prefix(1);
+            size_t query = relativePath.find('?');
+            if (query != std::string_view::npos)
+                relativePath = relativePath.substr(0, query);
+            if (relativePath.find('\0') != std::string_view::npos || relativePath.find('\\') != std::string_view::npos)
+                return false;
+
+            size_t start = 0;
+            while (start <= relativePath.size())
+            {
+                size_t end = std::min(relativePath.find('/', start), relativePath.size());
+                if (relativePath.substr(start, end - start) == "..")
+                    return false;
+                start = end + 1;
+            }
+
+            path.reserve(_root.size() + relativePath.size() + 12);
+            path = _root;
+            path.push_back('/');
+            path.append(relativePath.data(), relativePath.size());
+            if (relativePath.empty() || relativePath.back() == '/')
+                path.append("index.html");
+            return true;
+        }
+
+        // cached entry for path, re-checked with stat() at most every HTTP_STATIC_REVALIDATE_MS
+        std::shared_ptr<HTTPStaticFile> __lookup(const std::string &path)
+        {
+            std::shared_ptr<HTTPStaticFile> file;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto found = _index.find(path);
+                if (found == _index.end())
+                    return nullptr;
+                _lru.splice(_lru.begin(), _lru, found->second);
+                file = found->second->second;
+            }
+
+            uint64_t now = getTimestamp() / 1000;
+            if (now - file->_checkedAt < HTTP_STATIC_REVALIDATE_MS)
+                return file;
+            struct stat info;
+            if (stat(path.c_str(), &info) == 0 && file->matches(info))
+            {
+                file->_checkedAt = now;
+                return file;
+            }
+            __evict(path);
+            return nullptr;
+        }
+
+        std::shared_ptr<HTTPStaticFile> __insert(const std::string &path, int32_t fd, const struct stat &info)
+        {
+            void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+                return nullptr;
+            std::shared_ptr<HTTPStaticFile> file = std::make_shared<HTTPStaticFile>();
+            file->_data = data;
+            file->describe(info, path);
+            file->_checkedAt = getTimestamp() / 1000;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto found = _index.find(path);
+            if (found != _index.end())
+            {
+                _cachedBytes -= found->second->second->_size;
+                _lru.erase(found->second);
+                _index.erase(found);
+            }
+            // entries still being sent stay alive through their shared_ptr until the send ends
+            while (!_lru.empty() && _cachedBytes + file->_size > _cacheLimit)
+            {
+                _cachedBytes -= _lru.back().second->_size;
+                _index.erase(_lru.back().first);
+                _lru.pop_back();
+            }
+            _lru.emplace_front(path, file);
+            _index[path] = _lru.begin();
+            _cachedBytes += file->_size;
+            return file;
+        }
+
+        void __evict(const std::string &path)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto found = _index.find(path);
+            if (found == _index.end())
+                return;
+            _cachedBytes -= found->second->second->_size;
+            _lru.erase(found->second);
+            _index.erase(found);
+        }
+    };
+
+}; // namespace sp